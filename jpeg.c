@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,37 @@
 #include <vapoursynth/VSHelper.h>
 #include <vapoursynth/VapourSynth.h>
 
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define DECODE_FLAGS TJFLAG_ACCURATEDCT
+
+#define CACHE_MAGIC "VSJPGC02"
+#define CACHE_SUFFIX ".vsjc"
+#define CACHE_DEFAULT_SIZE 4096
+// temporary files left behind by an interrupted store are removed after this
+// many seconds
+#define CACHE_STALE_AGE 3600
+
+typedef struct JpegCache {
+    char *dir;
+#ifndef _WIN32
+    int64_t maxSize, used;
+    pthread_mutex_t lock;
+#endif
+} JpegCache;
+
 typedef struct JpegData {
     VSVideoInfo vi;
     VSFrameRef *frame;
@@ -15,8 +47,412 @@ typedef struct JpegsData {
     VSVideoInfo vi;
     int height1, width1, height2, width2, jpegSubSamp;
     char **paths;
+    JpegCache cache;
 } JpegsData;
 
+#ifndef _WIN32
+
+#ifdef __APPLE__
+#define ST_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint32_t keySize;
+    int32_t formatId, width, height;
+    uint64_t dataSize;
+} CacheHeader;
+
+typedef struct CacheEntry {
+    char *path;
+    int64_t size;
+    time_t mtime;
+} CacheEntry;
+
+static int cacheEntryCompare(const void *a, const void *b) {
+    time_t ma = ((const CacheEntry *)a)->mtime;
+    time_t mb = ((const CacheEntry *)b)->mtime;
+    return (ma > mb) - (ma < mb);
+}
+
+// scan the cache directory and, once it has grown past the size limit, delete
+// the least recently used entries until it is back under 3/4 of the limit.
+// temporary files count towards the limit and are deleted once stale.
+// must be called with the cache lock held
+static void cacheEvict(JpegCache *c) {
+    DIR *dir = opendir(c->dir);
+    if (dir == NULL) return;
+
+    CacheEntry *entries = NULL;
+    int numEntries = 0, capacity = 0;
+    int64_t used = 0;
+    size_t dirLen = strlen(c->dir), suffixLen = strlen(CACHE_SUFFIX);
+    time_t now = time(NULL);
+
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        // entries are named <hash>.vsjc, temporary files <hash>.vsjc.XXXXXX
+        const char *suffix = strstr(e->d_name, CACHE_SUFFIX);
+        if (suffix == NULL || suffix == e->d_name ||
+            (suffix[suffixLen] != '\0' && suffix[suffixLen] != '.'))
+            continue;
+        int isTemp = suffix[suffixLen] == '.';
+
+        if (!isTemp && numEntries == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            CacheEntry *tmp = (CacheEntry *)realloc(
+                entries, capacity * sizeof(CacheEntry));
+            if (tmp == NULL) break;
+            entries = tmp;
+        }
+
+        char *path = (char *)malloc(dirLen + strlen(e->d_name) + 2);
+        if (path == NULL) break;
+        sprintf(path, "%s/%s", c->dir, e->d_name);
+
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (isTemp) {
+            if (now - st.st_mtime <= CACHE_STALE_AGE || unlink(path) != 0)
+                used += st.st_size;
+            free(path);
+            continue;
+        }
+        entries[numEntries].path = path;
+        entries[numEntries].size = st.st_size;
+        entries[numEntries].mtime = st.st_mtime;
+        numEntries++;
+        used += st.st_size;
+    }
+    closedir(dir);
+
+    if (used > c->maxSize) {
+        int64_t target = c->maxSize - c->maxSize / 4;
+        qsort(entries, numEntries, sizeof(CacheEntry), cacheEntryCompare);
+        for (int i = 0; i < numEntries && used > target; i++) {
+            if (unlink(entries[i].path) == 0) used -= entries[i].size;
+        }
+    }
+    for (int i = 0; i < numEntries; i++) free(entries[i].path);
+    free(entries);
+
+    c->used = used;
+}
+
+// returns an error message if a cache directory was requested but cannot be
+// used, NULL otherwise
+static const char *cacheInit(JpegCache *c, const VSMap *in,
+                             const VSAPI *vsapi) {
+    int err;
+    c->dir = NULL;
+    const char *dir = vsapi->propGetData(in, "cache", 0, &err);
+    if (err || dir[0] == '\0') return NULL;
+
+    // leave room for "/<16 hex digits>.vsjc.XXXXXX"
+    if (strlen(dir) + 32 >= PATH_MAX) return "cache directory path is too long";
+
+    struct stat st;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return "unable to create cache directory";
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+        return "cache path is not a directory";
+
+    int64_t maxSize = vsapi->propGetInt(in, "cachesize", 0, &err);
+    if (maxSize <= 0) maxSize = CACHE_DEFAULT_SIZE;
+    if (maxSize > (INT64_MAX >> 20)) maxSize = INT64_MAX >> 20;
+    c->maxSize = maxSize << 20;
+
+    c->dir = (char *)malloc(strlen(dir) + 1);
+    if (c->dir == NULL) return "unable to allocate memory for cache";
+    strcpy(c->dir, dir);
+    pthread_mutex_init(&c->lock, NULL);
+
+    pthread_mutex_lock(&c->lock);
+    cacheEvict(c);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static void cacheFree(JpegCache *c) {
+    if (c->dir == NULL) return;
+    pthread_mutex_destroy(&c->lock);
+    free(c->dir);
+    c->dir = NULL;
+}
+
+// the key identifies the decoded output: the filter, every source file by
+// canonical path, device, inode, mtime and size, and the decode flags.
+// returns NULL if a source cannot be resolved, in which case the cache is
+// bypassed
+static uint8_t *cacheKey(const char *tag, const char **paths, int numPaths,
+                         size_t *keySize) {
+    int32_t flags = DECODE_FLAGS;
+    uint8_t *key = NULL;
+    char **realPaths = (char **)calloc(numPaths, sizeof(char *));
+    int64_t(*fields)[5] = (int64_t(*)[5])malloc(numPaths * sizeof(*fields));
+    if (realPaths == NULL || fields == NULL) goto done;
+
+    size_t size = strlen(tag) + 1 + sizeof(flags);
+    for (int i = 0; i < numPaths; i++) {
+        struct stat st;
+        if ((realPaths[i] = realpath(paths[i], NULL)) == NULL ||
+            stat(realPaths[i], &st) != 0)
+            goto done;
+        fields[i][0] = st.st_dev;
+        fields[i][1] = st.st_ino;
+        fields[i][2] = st.st_mtime;
+        fields[i][3] = ST_MTIME_NSEC(st);
+        fields[i][4] = st.st_size;
+        size += strlen(realPaths[i]) + 1 + sizeof(fields[i]);
+    }
+
+    if ((key = (uint8_t *)malloc(size)) == NULL) goto done;
+
+    uint8_t *p = key;
+    memcpy(p, tag, strlen(tag) + 1);
+    p += strlen(tag) + 1;
+    for (int i = 0; i < numPaths; i++) {
+        memcpy(p, realPaths[i], strlen(realPaths[i]) + 1);
+        p += strlen(realPaths[i]) + 1;
+        memcpy(p, fields[i], sizeof(fields[i]));
+        p += sizeof(fields[i]);
+    }
+    memcpy(p, &flags, sizeof(flags));
+    *keySize = size;
+
+done:
+    if (realPaths != NULL) {
+        for (int i = 0; i < numPaths; i++) free(realPaths[i]);
+    }
+    free(realPaths);
+    free(fields);
+    return key;
+}
+
+// returns 0 if the entry path does not fit in path
+static int cachePath(const JpegCache *c, const uint8_t *key, size_t keySize,
+                     char *path, size_t pathSize) {
+    // 64-bit FNV-1a, collisions are caught by comparing the stored key
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < keySize; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    int len = snprintf(path, pathSize, "%s/%016llx" CACHE_SUFFIX, c->dir,
+                       (unsigned long long)hash);
+    return len >= 0 && (size_t)len < pathSize;
+}
+
+// the API cannot wrap the mapping in a frame, so hits are always copied out and
+// the planes are stored unpadded straight after the key
+static size_t cacheDataOffset(size_t keySize) {
+    return sizeof(CacheHeader) + keySize;
+}
+
+static uint64_t cacheDataSize(const VSFormat *format, int width, int height) {
+    uint64_t size = 0;
+    for (int p = 0; p < format->numPlanes; p++) {
+        int w = p ? width >> format->subSamplingW : width;
+        int h = p ? height >> format->subSamplingH : height;
+        size += (uint64_t)w * h * format->bytesPerSample;
+    }
+    return size;
+}
+
+// returns 0 on a short write, e.g. when the cache filesystem is full
+static int cacheWrite(int fd, const uint8_t *buf, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buf, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buf += written;
+        size -= written;
+    }
+    return 1;
+}
+
+// writes the rows of a plane straight from the frame, batching them into as
+// few system calls as possible. returns 0 on a short write
+static int cacheWritePlane(int fd, const uint8_t *src, int stride, int rowSize,
+                           int height) {
+    if (stride == rowSize) return cacheWrite(fd, src, (size_t)rowSize * height);
+
+    struct iovec iov[64];
+    for (int y = 0; y < height;) {
+        int n = height - y < 64 ? height - y : 64;
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)(src + (size_t)(y + i) * stride);
+            iov[i].iov_len = rowSize;
+        }
+        ssize_t written = writev(fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        // finish a partially written batch a row at a time
+        for (int i = 0; i < n; i++) {
+            if (written >= rowSize) {
+                written -= rowSize;
+                continue;
+            }
+            if (!cacheWrite(fd, (const uint8_t *)iov[i].iov_base + written,
+                            rowSize - written))
+                return 0;
+            written = 0;
+        }
+        y += n;
+    }
+    return 1;
+}
+
+// returns a new frame with the planes stored under key, or NULL on a miss
+static VSFrameRef *cacheLoad(const JpegCache *c, const uint8_t *key,
+                             size_t keySize, VSCore *core,
+                             const VSAPI *vsapi) {
+    char path[PATH_MAX];
+    if (!cachePath(c, key, keySize, path, sizeof(path))) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    uint8_t *map =
+        (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    VSFrameRef *frame = NULL;
+    const CacheHeader *h = (const CacheHeader *)map;
+    size_t offset = cacheDataOffset(keySize);
+    const VSFormat *format;
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->keySize != keySize || offset > (size_t)st.st_size ||
+        memcmp(map + sizeof(CacheHeader), key, keySize) != 0 ||
+        h->width <= 0 || h->height <= 0 ||
+        (format = vsapi->getFormatPreset(h->formatId, core)) == NULL ||
+        h->dataSize != cacheDataSize(format, h->width, h->height) ||
+        offset + h->dataSize != (uint64_t)st.st_size)
+        goto unmap;
+
+    frame = vsapi->newVideoFrame(format, h->width, h->height, NULL, core);
+    const uint8_t *src = map + offset;
+    for (int p = 0; p < format->numPlanes; p++) {
+        int rowSize = vsapi->getFrameWidth(frame, p) * format->bytesPerSample;
+        int height = vsapi->getFrameHeight(frame, p);
+        vs_bitblt(vsapi->getWritePtr(frame, p), vsapi->getStride(frame, p),
+                  src, rowSize, rowSize, height);
+        src += (size_t)rowSize * height;
+    }
+    // bump the mtime so eviction sees the entry as recently used
+    utimes(path, NULL);
+
+unmap:
+    munmap(map, st.st_size);
+    return frame;
+}
+
+static void cacheStore(JpegCache *c, const uint8_t *key, size_t keySize,
+                       const VSFrameRef *frame, const VSAPI *vsapi) {
+    const VSFormat *format = vsapi->getFrameFormat(frame);
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.keySize = keySize;
+    h.formatId = format->id;
+    h.width = vsapi->getFrameWidth(frame, 0);
+    h.height = vsapi->getFrameHeight(frame, 0);
+    h.dataSize = cacheDataSize(format, h.width, h.height);
+
+    size_t offset = cacheDataOffset(keySize);
+    int64_t total = offset + h.dataSize;
+    if (total > c->maxSize) return;
+
+    // write to a temporary file and rename it into place so that concurrent
+    // readers never see a partially written entry
+    char path[PATH_MAX], tmp[PATH_MAX];
+    if (!cachePath(c, key, keySize, path, sizeof(path))) return;
+    int len = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if (len < 0 || (size_t)len >= sizeof(tmp)) return;
+    int fd = mkstemp(tmp);
+    if (fd == -1) return;
+
+    uint8_t *buf = (uint8_t *)malloc(offset);
+    if (buf == NULL) goto fail;
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), key, keySize);
+    int ok = cacheWrite(fd, buf, offset);
+    free(buf);
+    if (!ok) goto fail;
+
+    for (int p = 0; p < format->numPlanes; p++) {
+        int rowSize = vsapi->getFrameWidth(frame, p) * format->bytesPerSample;
+        if (!cacheWritePlane(fd, vsapi->getReadPtr(frame, p),
+                             vsapi->getStride(frame, p), rowSize,
+                             vsapi->getFrameHeight(frame, p)))
+            goto fail;
+    }
+    if (close(fd) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->used += total;
+    if (c->used > c->maxSize) cacheEvict(c);
+    pthread_mutex_unlock(&c->lock);
+    return;
+
+fail:
+    close(fd);
+    unlink(tmp);
+}
+
+#else
+
+// the cache relies on POSIX file APIs, so it is unavailable on Windows
+
+static const char *cacheInit(JpegCache *c, const VSMap *in,
+                             const VSAPI *vsapi) {
+    int err;
+    c->dir = NULL;
+    const char *dir = vsapi->propGetData(in, "cache", 0, &err);
+    if (err || dir[0] == '\0') return NULL;
+    return "cache is not supported on this platform";
+}
+
+static void cacheFree(JpegCache *c) {}
+
+static uint8_t *cacheKey(const char *tag, const char **paths, int numPaths,
+                         size_t *keySize) {
+    return NULL;
+}
+
+static VSFrameRef *cacheLoad(const JpegCache *c, const uint8_t *key,
+                             size_t keySize, VSCore *core,
+                             const VSAPI *vsapi) {
+    return NULL;
+}
+
+static void cacheStore(JpegCache *c, const uint8_t *key, size_t keySize,
+                       const VSFrameRef *frame, const VSAPI *vsapi) {}
+
+#endif
+
 static void VS_CC jpegInit(VSMap *in, VSMap *out, void **instanceData,
                            VSNode *node, VSCore *core, const VSAPI *vsapi) {
     JpegData *d = (JpegData *)*instanceData;
@@ -45,6 +481,25 @@ static const VSFrameRef *VS_CC jpegsGetFrame(int n, int activationReason,
                                              VSCore *core, const VSAPI *vsapi) {
     JpegsData *d = (JpegsData *)*instanceData;
 
+    uint8_t *key = NULL;
+    size_t keySize;
+    if (d->cache.dir != NULL &&
+        (key = cacheKey("Jpegs", (const char **)&d->paths[n], 1,
+                        &keySize)) != NULL) {
+        VSFrameRef *cached = cacheLoad(&d->cache, key, keySize, core, vsapi);
+        if (cached != NULL) {
+            if (vsapi->getFrameFormat(cached) == d->vi.format &&
+                vsapi->getFrameWidth(cached, 0) == d->width1 &&
+                vsapi->getFrameHeight(cached, 0) == d->height1) {
+                free(key);
+                VSMap *props = vsapi->getFramePropsRW(cached);
+                vsapi->propSetInt(props, "_ColorRange", 0, paReplace);
+                return cached;
+            }
+            vsapi->freeFrame(cached);
+        }
+    }
+
     VSFrameRef *dst =
         vsapi->newVideoFrame(d->vi.format, d->width1, d->height1, NULL, core);
 
@@ -62,16 +517,17 @@ static const VSFrameRef *VS_CC jpegsGetFrame(int n, int activationReason,
     uint8_t *buf[3] = {vsapi->getWritePtr(dst, 0), vsapi->getWritePtr(dst, 1),
                        vsapi->getWritePtr(dst, 2)};
 
+    int ret;
     tjhandle handle = tjInitDecompress();
     if (d->vi.format->id == pfYUV420P8) {
-        tjDecompressToYUVPlanes(handle, jpegBuf, size, buf, d->width1, strides,
-                                d->height1, TJFLAG_ACCURATEDCT);
+        ret = tjDecompressToYUVPlanes(handle, jpegBuf, size, buf, d->width1, strides,
+                                d->height1, DECODE_FLAGS);
         free(jpegBuf);
         tjDestroy(handle);
     } else {
         uint8_t tmp[d->width1 * d->height1 * 3];
-        tjDecompress2(handle, jpegBuf, size, tmp, d->width1, d->width1 * 3, 0,
-                      TJPF_RGB, TJFLAG_ACCURATEDCT);
+        ret = tjDecompress2(handle, jpegBuf, size, tmp, d->width1,
+                            d->width1 * 3, 0, TJPF_RGB, DECODE_FLAGS);
         free(jpegBuf);
         tjDestroy(handle);
 
@@ -86,6 +542,12 @@ static const VSFrameRef *VS_CC jpegsGetFrame(int n, int activationReason,
         }
     }
 
+    // never cache the partially written frame left by a failed decode
+    if (key != NULL) {
+        if (ret == 0) cacheStore(&d->cache, key, keySize, dst, vsapi);
+        free(key);
+    }
+
     VSMap *props = vsapi->getFramePropsRW(dst);
     vsapi->propSetInt(props, "_ColorRange", 0, paReplace);
 
@@ -104,6 +566,7 @@ static void VS_CC jpegsFree(void *instanceData, VSCore *core,
     JpegsData *d = (JpegsData *)instanceData;
     for (int i = 0; i < d->vi.numFrames; i++) free(d->paths[i]);
     free(d->paths);
+    cacheFree(&d->cache);
     free(d);
 }
 
@@ -194,7 +657,7 @@ static void VS_CC jpegCreate(const VSMap *in, VSMap *out, void *userData,
                                (uint8_t *)malloc(chromaMem),
                                (uint8_t *)malloc(chromaMem)};
             if (tjDecompressToYUVPlanes(handle, jpegBuf, size, buf, 0, strides,
-                                        0, TJFLAG_ACCURATEDCT) == -1) {
+                                        0, DECODE_FLAGS) == -1) {
                 free(jpegBuf);
                 tjDestroy(handle);
                 vsapi->setError(out, tjGetErrorStr2(handle));
@@ -214,7 +677,7 @@ static void VS_CC jpegCreate(const VSMap *in, VSMap *out, void *userData,
                               vsapi->getStride(d->frame, 2)};
 
             if (tjDecompressToYUVPlanes(handle, jpegBuf, size, buf, 0, strides,
-                                        0, TJFLAG_ACCURATEDCT) == -1) {
+                                        0, DECODE_FLAGS) == -1) {
                 free(jpegBuf);
                 tjDestroy(handle);
                 vsapi->setError(out, tjGetErrorStr2(handle));
@@ -228,7 +691,7 @@ static void VS_CC jpegCreate(const VSMap *in, VSMap *out, void *userData,
         int stride = vsapi->getStride(d->frame, 0);
         uint8_t *plane = vsapi->getWritePtr(d->frame, 0);
         if (tjDecompressToYUVPlanes(handle, jpegBuf, size, &plane, 0, &stride,
-                                    0, TJFLAG_ACCURATEDCT) == -1) {
+                                    0, DECODE_FLAGS) == -1) {
             free(jpegBuf);
             tjDestroy(handle);
             vsapi->setError(out, tjGetErrorStr2(handle));
@@ -242,7 +705,7 @@ static void VS_CC jpegCreate(const VSMap *in, VSMap *out, void *userData,
         int pixels = width * height;
         uint8_t *buf = (uint8_t *)malloc(pixels * 3);
         if (tjDecompress2(handle, jpegBuf, size, buf, 0, 0, 0, TJPF_RGB,
-                          TJFLAG_ACCURATEDCT) == -1) {
+                          DECODE_FLAGS) == -1) {
             free(jpegBuf);
             free(buf);
             tjDestroy(handle);
@@ -296,6 +759,19 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
     d->vi.fpsDen = vsapi->propGetInt(in, "fpsden", 0, &err);
     if (d->vi.fpsDen <= 0) d->vi.fpsDen = 1;
 
+    JpegCache cache;
+    const char *cacheError = cacheInit(&cache, in, vsapi);
+    if (cacheError != NULL) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Stitch: %s", cacheError);
+        vsapi->setError(out, msg);
+        tjDestroy(handle);
+        free(d);
+        return;
+    }
+    uint8_t *key = NULL;
+    size_t keySize;
+
     int allocatedPlanes = 0;
     int colorspace, subSamp, height, subW, subH;
     int totalWidth = 0;
@@ -312,6 +788,24 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
         goto free1;
     }
 
+    if (cache.dir != NULL) {
+        const char **paths = (const char **)malloc(numFiles * sizeof(char *));
+        if (paths != NULL) {
+            for (int i = 0; i < numFiles; i++)
+                paths[i] = vsapi->propGetData(in, "filename", i, NULL);
+            key = cacheKey("Stitch", paths, numFiles, &keySize);
+            free(paths);
+        }
+        if (key != NULL &&
+            (d->frame = cacheLoad(&cache, key, keySize, core, vsapi)) !=
+                NULL) {
+            d->vi.format = vsapi->getFrameFormat(d->frame);
+            d->vi.width = vsapi->getFrameWidth(d->frame, 0);
+            d->vi.height = vsapi->getFrameHeight(d->frame, 0);
+            goto create;
+        }
+    }
+
     uint8_t *jpegBuf;
 
     for (int fileNum = 0; fileNum < numFiles; fileNum++) {
@@ -433,7 +927,7 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
 
                 if (tjDecompressToYUVPlanes(
                         handle, jpegBuf, size, planes[fileNum], 0,
-                        strides[fileNum], 0, TJFLAG_ACCURATEDCT) == -1) {
+                        strides[fileNum], 0, DECODE_FLAGS) == -1) {
                     vsapi->setError(out, tjGetErrorStr2(handle));
                     goto free3;
                 }
@@ -466,7 +960,7 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
 
                 if (tjDecompressToYUVPlanes(
                         handle, jpegBuf, size, planes[fileNum], 0,
-                        strides[fileNum], 0, TJFLAG_ACCURATEDCT) == -1) {
+                        strides[fileNum], 0, DECODE_FLAGS) == -1) {
                     vsapi->setError(out, tjGetErrorStr2(handle));
                     goto free3;
                 }
@@ -482,7 +976,7 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
                     goto free3;
                 }
                 if (tjDecompress2(handle, jpegBuf, size, buf, 0, 0, 0, TJPF_RGB,
-                                  TJFLAG_ACCURATEDCT) == -1) {
+                                  DECODE_FLAGS) == -1) {
                     free(buf);
                     vsapi->setError(out, tjGetErrorStr2(handle));
                     goto free3;
@@ -564,6 +1058,9 @@ static void VS_CC stitchCreate(const VSMap *in, VSMap *out, void *userData,
         free(strides[i]);
         free(widths[i]);
     }
+    if (key != NULL) cacheStore(&cache, key, keySize, d->frame, vsapi);
+
+create:;
     VSMap *props = vsapi->getFramePropsRW(d->frame);
     vsapi->propSetInt(props, "_ColorRange", 0, paReplace);
 
@@ -584,6 +1081,8 @@ free1:
     free(strides);
     free(planes);
     free(widths);
+    free(key);
+    cacheFree(&cache);
     tjDestroy(handle);
 }
 
@@ -639,6 +1138,16 @@ static void VS_CC jpegsCreate(const VSMap *in, VSMap *out, void *userData,
         return;
     }
 
+    const char *cacheError = cacheInit(&d->cache, in, vsapi);
+    if (cacheError != NULL) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Jpeg: %s", cacheError);
+        vsapi->setError(out, msg);
+        tjDestroy(handle);
+        jpegsFree(d, core, vsapi);
+        return;
+    }
+
     tjDestroy(handle);
 
     vsapi->createFilter(in, out, "Jpegs", jpegsInit, jpegsGetFrame, jpegsFree,
@@ -652,8 +1161,12 @@ VapourSynthPluginInit(VSConfigPlugin configFunc,
                VAPOURSYNTH_API_VERSION, 1, plugin);
     registerFunc("Jpeg", "filename:data;fpsnum:int:opt;fpsden:int:opt;",
                  jpegCreate, NULL, plugin);
-    registerFunc("Stitch", "filename:data[];fpsnum:int:opt;fpsden:int:opt;",
+    registerFunc("Stitch",
+                 "filename:data[];fpsnum:int:opt;fpsden:int:opt;"
+                 "cache:data:opt;cachesize:int:opt;",
                  stitchCreate, NULL, plugin);
-    registerFunc("Jpegs", "filename:data[];fpsnum:int:opt;fpsden:int:opt;",
+    registerFunc("Jpegs",
+                 "filename:data[];fpsnum:int:opt;fpsden:int:opt;"
+                 "cache:data:opt;cachesize:int:opt;",
                  jpegsCreate, NULL, plugin);
 }